@@ -0,0 +1,149 @@
+/*
+ * bench_lookup.c - Hot-path name compare cost, before and after ingest-time
+ * canonicalization
+ *
+ * "before" replays the old dlz_lookup() scan: strcasecmp() of the query
+ * against each stored (sanitized but unfolded) hostname.
+ * "after" is the current scan: fold the query once with nb_fold_query(),
+ * then length check + memcmp() against labels built by nb_build_records().
+ *
+ * Both walk the same-shaped nb_record_t list, so the difference is the
+ * compare itself. Logging and locking are left out on purpose.
+ *
+ * Build & run:  make bench  (or: ./bench_lookup [peers] [lookups])
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "netbird_dlz.c"
+
+/* BIND normally provides this; unused by the benchmark */
+isc_result_t dns_sdlz_putrr(dns_sdlzlookup_t *lookup, const char *type,
+                            dns_ttl_t ttl, const char *data) {
+    (void)lookup;
+    (void)type;
+    (void)ttl;
+    (void)data;
+    return ISC_R_SUCCESS;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Realistic-looking hostnames; most share the "Peer-Host-" prefix */
+static void make_hostname(unsigned i, char *buf, size_t len) {
+    static const char *stems[] = { "Peer-Host-", "LAPTOP-", "build-runner-", "NAS " };
+    snprintf(buf, len, "%s%u", stems[i % 4], i);
+}
+
+static const nb_record_t *scan_before(const nb_record_t *head, const char *name) {
+    for (const nb_record_t *curr = head; curr; curr = curr->next) {
+        if (strcasecmp(curr->hostname, name) == 0) return curr;
+    }
+    return NULL;
+}
+
+static const nb_record_t *scan_after(const nb_record_t *head, const char *name) {
+    char key[NB_LABEL_MAX + 1];
+    size_t key_len = nb_fold_query(name, key, sizeof(key));
+    if (key_len == 0) return NULL;
+    for (const nb_record_t *curr = head; curr; curr = curr->next) {
+        if (curr->hostname_len == key_len && memcmp(curr->hostname, key, key_len) == 0) return curr;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned peers = argc > 1 ? (unsigned)atoi(argv[1]) : 1000;
+    unsigned lookups = argc > 2 ? (unsigned)atoi(argv[2]) : 200000;
+    if (peers == 0 || lookups == 0) {
+        fprintf(stderr, "usage: %s [peers] [lookups]\n", argv[0]);
+        return 2;
+    }
+
+    nb_state_t state = {0};
+
+    // "before" list: legacy sanitizing only (spaces to '-'), case preserved
+    nb_record_t *legacy = NULL;
+    nb_pending_t *pending = calloc(peers, sizeof(nb_pending_t));
+    if (!pending) return 2;
+
+    for (unsigned i = peers; i-- > 0;) {
+        char host[64];
+        make_hostname(i, host, sizeof(host));
+
+        nb_record_t *node = calloc(1, sizeof(nb_record_t));
+        node->hostname = strdup(host);
+        for (char *p = node->hostname; *p; p++) {
+            if (*p == ' ') *p = '-';
+        }
+        node->ip = strdup("100.64.0.1");
+        node->next = legacy;
+        legacy = node;
+
+        nb_canonicalize_label(NULL, host, pending[i].label, sizeof(pending[i].label), NULL);
+        pending[i].ip = strdup("100.64.0.1");
+    }
+
+    // "after" list: built by the real ingest path
+    nb_record_t *canonical = nb_build_records(&state, pending, peers);
+    free(pending);
+
+    // Queries as BIND would send them: mixed case, ~10% misses
+    char (*queries)[64] = malloc((size_t)lookups * 64);
+    if (!queries) return 2;
+    unsigned seed = 42;
+    for (unsigned i = 0; i < lookups; i++) {
+        unsigned r = (unsigned)rand_r(&seed);
+        if (r % 10 == 0) {
+            snprintf(queries[i], 64, "missing-host-%u", r);
+        } else {
+            make_hostname(r % peers, queries[i], 64);
+            for (char *p = queries[i]; *p; p++) {
+                if (*p == ' ') *p = '-';
+                else if (r & 1) *p = (char)((*p >= 'a' && *p <= 'z') ? *p - 32 : *p);
+            }
+        }
+    }
+
+    volatile size_t sink = 0;
+    size_t hits_before = 0, hits_after = 0;
+
+    double t0 = now_sec();
+    for (unsigned i = 0; i < lookups; i++) {
+        const nb_record_t *r = scan_before(legacy, queries[i]);
+        if (r) { hits_before++; sink += (size_t)r->ip[0]; }
+    }
+    double t_before = now_sec() - t0;
+
+    t0 = now_sec();
+    for (unsigned i = 0; i < lookups; i++) {
+        const nb_record_t *r = scan_after(canonical, queries[i]);
+        if (r) { hits_after++; sink += (size_t)r->ip[0]; }
+    }
+    double t_after = now_sec() - t0;
+
+    printf("peers=%u lookups=%u\n", peers, lookups);
+    printf("before (strcasecmp):        %8.1f ns/lookup  %6.2f ns/record  hits=%zu\n",
+           t_before * 1e9 / lookups, t_before * 1e9 / lookups / peers, hits_before);
+    printf("after  (fold + len/memcmp): %8.1f ns/lookup  %6.2f ns/record  hits=%zu\n",
+           t_after * 1e9 / lookups, t_after * 1e9 / lookups / peers, hits_after);
+    printf("speedup: %.2fx\n", t_after > 0 ? t_before / t_after : 0.0);
+
+    free(queries);
+    free_record_list(legacy);
+    free_record_list(canonical);
+
+    if (hits_before != hits_after) {
+        fprintf(stderr, "bench: hit counts differ (%zu vs %zu)\n", hits_before, hits_after);
+        return 1;
+    }
+    return 0;
+}
@@ -9,6 +9,8 @@
 #include <jansson.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <idn2.h>
 
 /* BIND 9.18+ DLZ headers */
 #include <dns/dlz_dlopen.h>
@@ -21,6 +23,15 @@
 #define NB_REFRESH_INTERVAL_SECONDS 300  // N minutes (e.g. 5 mins)
 #define NB_USER_AGENT "bind-dlz-netbird/1.0"
 #define NB_MAX_URL_LEN 512
+#define NB_LABEL_MAX 63                  // RFC 1035 label length limit
+
+// Overridable at build time (the soak test points these at /dev/null)
+#ifndef NB_LOG_PATH
+#define NB_LOG_PATH "/tmp/dlz.log"
+#endif
+#ifndef NB_DEBUG_DUMP_PATH
+#define NB_DEBUG_DUMP_PATH "/tmp/netbird_debug.json"
+#endif
 
 /******************************************************************************
  * DATA STRUCTURES
@@ -28,11 +39,21 @@
 
 /* Linked List Node for DNS Records */
 typedef struct nb_record {
-    char *hostname;         // e.g., "nas"
+    char *hostname;         // canonical lowercase LDH label, e.g., "nas"
+    size_t hostname_len;    // strlen(hostname), checked before memcmp
     char *ip;              // e.g., "100.64.0.5"
     struct nb_record *next;
 } nb_record_t;
 
+/* Peer collected during ingest, before duplicate resolution */
+typedef struct nb_pending {
+    char label[NB_LABEL_MAX + 1];
+    char *ip;
+    char *peer_id;          // NetBird peer id, tie-breaker for duplicates
+    int from_dns_label;     // label came from NetBird's dns_label, not hostname
+    int duplicate;          // label clashes with an earlier entry
+} nb_pending_t;
+
 /* Global State (The "Survivor" Struct) */
 typedef struct nb_state {
     // Configuration
@@ -59,7 +80,7 @@ typedef struct nb_state {
 static void nb_log(nb_state_t *state, int level, const char *fmt, ...) {
     (void)state;  // unused
     (void)level;  // unused for now
-    FILE *fp = fopen("/tmp/dlz.log", "a");
+    FILE *fp = fopen(NB_LOG_PATH, "a");
     if (fp) {
         va_list args;
         va_start(args, fmt);
@@ -71,6 +92,313 @@ static void nb_log(nb_state_t *state, int level, const char *fmt, ...) {
     }
 }
 
+/******************************************************************************
+ * NAME CANONICALIZATION
+ ******************************************************************************/
+
+/*
+ * All name folding and validation happens once per refresh, here. Records end
+ * up with a lowercase LDH label (RFC 1123 letters/digits/hyphen, IDNA A-label
+ * for non-ASCII), so dlz_lookup() only folds the query and does length + memcmp.
+ */
+
+#define NB_NAME_BUF 256     // UTF-8 bytes of one label before IDNA conversion
+
+/* Decodes one UTF-8 sequence. Returns bytes consumed, or 0 if invalid. */
+static size_t nb_utf8_decode(const unsigned char *s, uint32_t *cp) {
+    if (s[0] < 0x80) {
+        *cp = s[0];
+        return 1;
+    }
+    size_t need;
+    uint32_t c, min;
+    if ((s[0] & 0xE0) == 0xC0) { need = 1; c = s[0] & 0x1F; min = 0x80; }
+    else if ((s[0] & 0xF0) == 0xE0) { need = 2; c = s[0] & 0x0F; min = 0x800; }
+    else if ((s[0] & 0xF8) == 0xF0) { need = 3; c = s[0] & 0x07; min = 0x10000; }
+    else return 0;
+
+    for (size_t i = 1; i <= need; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return 0;
+    *cp = c;
+    return need + 1;
+}
+
+/* Checks an already folded label against the LDH rules */
+static int nb_label_is_ldh(const char *label, size_t len) {
+    if (len == 0 || len > NB_LABEL_MAX) return 0;
+    if (label[0] == '-' || label[len - 1] == '-') return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = label[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-')) return 0;
+    }
+    // "??--" is reserved for A-labels (RFC 5891 4.2.3.1)
+    if (len >= 4 && label[2] == '-' && label[3] == '-') {
+        if (strncmp(label, "xn", 2) != 0) return 0;
+
+        // An A-label must be exactly what IDNA produces for its own U-label
+        char *ulabel = NULL, *alabel = NULL;
+        int ok = idn2_to_unicode_8z8z(label, &ulabel, 0) == IDN2_OK &&
+                 idn2_to_ascii_8z(ulabel, &alabel, IDN2_NFC_INPUT | IDN2_NONTRANSITIONAL) == IDN2_OK &&
+                 strcmp(alabel, label) == 0;
+        idn2_free(ulabel);
+        idn2_free(alabel);
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Folds one name to its canonical label: first DNS label only, ASCII is
+ * lowercased, any other ASCII outside [a-z0-9-] (spaces, '_', '\'', ...)
+ * becomes '-' without doubling an adjacent '-', and leading/trailing '-' are
+ * trimmed. Non-ASCII goes through IDNA2008 with UTS #46 mapping (case
+ * folding, NFC), which is what resolvers send, so "BÜRO" and "büro" both
+ * become "xn--bro-hoa". Returns the label length, or -1 if nothing valid is
+ * left or the name cannot be converted.
+ */
+static int nb_fold_label(const char *name, char *out, size_t out_size) {
+    char buf[NB_NAME_BUF];
+    size_t len = 0;
+    size_t dashes = 0;      // held back so trailing ones never count
+    int dash_mapped = 0;    // held dashes include a substituted one
+    int ascii = 1;
+
+    const unsigned char *p = (const unsigned char *)name;
+    while (*p && *p != '.') {
+        uint32_t c;
+        size_t used = nb_utf8_decode(p, &c);
+        if (used == 0) return -1;
+
+        if (c < 0x80 && !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                          (c >= '0' && c <= '9') || c == '-')) {
+            dashes++;
+            dash_mapped = 1;
+            p += used;
+            continue;
+        }
+        if (c == '-') {
+            dashes++;
+            p += used;
+            continue;
+        }
+
+        // Leading '-' is dropped; "a - b" collapses but a literal "a--b" stays
+        if (len > 0 && dashes > 0) {
+            size_t emit = dash_mapped ? 1 : dashes;
+            if (len + emit >= sizeof(buf)) return -1;
+            memset(buf + len, '-', emit);
+            len += emit;
+        }
+        dashes = 0;
+        dash_mapped = 0;
+
+        if (len + used >= sizeof(buf)) return -1;
+        if (c >= 'A' && c <= 'Z') {
+            buf[len++] = (char)(c + ('a' - 'A'));
+        } else {
+            memcpy(buf + len, p, used);
+            len += used;
+        }
+        if (c >= 0x80) ascii = 0;
+        p += used;
+    }
+    buf[len] = '\0';
+    if (len == 0) return -1;
+
+    if (ascii) {
+        if (len >= out_size) return -1;
+        memcpy(out, buf, len + 1);
+    } else {
+        char *alabel = NULL;
+        if (idn2_to_ascii_8z(buf, &alabel, IDN2_NFC_INPUT | IDN2_NONTRANSITIONAL) != IDN2_OK) {
+            return -1;
+        }
+        len = strlen(alabel);
+        int fits = len < out_size;
+        if (fits) memcpy(out, alabel, len + 1);
+        idn2_free(alabel);
+        if (!fits) return -1;
+    }
+
+    return nb_label_is_ldh(out, len) ? (int)len : -1;
+}
+
+/*
+ * Picks the label a peer is served under. NetBird's dns_label (e.g.
+ * "nas.netbird.cloud") is preferred since NetBird already keeps it unique per
+ * account; the raw hostname is the fallback. *from_dns_label (may be NULL)
+ * tells which one was used.
+ */
+static int nb_canonicalize_label(const char *dns_label, const char *hostname,
+                                 char *out, size_t out_size, int *from_dns_label) {
+    int len = -1;
+    if (from_dns_label) *from_dns_label = 0;
+    if (dns_label && *dns_label) {
+        len = nb_fold_label(dns_label, out, out_size);
+        if (len >= 0 && from_dns_label) *from_dns_label = 1;
+    }
+    if (len < 0 && hostname && *hostname) {
+        len = nb_fold_label(hostname, out, out_size);
+    }
+    return len;
+}
+
+/*
+ * Query-side counterpart of nb_fold_label(): ASCII lowercase only, since BIND
+ * hands us the wire form (punycode) of the name. Returns the key length, or 0
+ * if the name cannot match any record: empty, longer than a DNS label, or
+ * more than one label (records are single labels directly under the zone).
+ */
+static size_t nb_fold_query(const char *name, char *key, size_t key_size) {
+    size_t len = 0;
+    for (; name[len]; len++) {
+        if (len + 1 >= key_size) return 0;
+        char c = name[len];
+        if (c == '.') return 0;
+        key[len] = (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+    }
+    key[len] = '\0';
+    return len;
+}
+
+static int nb_pending_cmp(const void *a, const void *b) {
+    const nb_pending_t *pa = (const nb_pending_t *)a;
+    const nb_pending_t *pb = (const nb_pending_t *)b;
+    int r = strcmp(pa->label, pb->label);
+    if (r == 0) r = pb->from_dns_label - pa->from_dns_label;  // dns_label first
+    if (r == 0) r = strcmp(pa->peer_id ? pa->peer_id : "", pb->peer_id ? pb->peer_id : "");
+    if (r == 0) r = strcmp(pa->ip ? pa->ip : "", pb->ip ? pb->ip : "");
+    return r;
+}
+
+/* Open-addressing set of labels, used only while resolving duplicates */
+typedef struct nb_label_set {
+    const char **slots;
+    size_t mask;
+} nb_label_set_t;
+
+static uint32_t nb_label_hash(const char *s) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Sized for up to count inserts at <= 50% load */
+static int nb_label_set_init(nb_label_set_t *set, size_t count) {
+    size_t size = 16;
+    while (size < count * 2) size <<= 1;
+    set->slots = calloc(size, sizeof(const char *));
+    if (!set->slots) return -1;
+    set->mask = size - 1;
+    return 0;
+}
+
+/* Inserts label (not copied). Returns 1 if added, 0 if it was already taken. */
+static int nb_label_set_add(nb_label_set_t *set, const char *label) {
+    size_t i = nb_label_hash(label) & set->mask;
+    while (set->slots[i]) {
+        if (strcmp(set->slots[i], label) == 0) return 0;
+        i = (i + 1) & set->mask;
+    }
+    set->slots[i] = label;
+    return 1;
+}
+
+/*
+ * Resolves duplicate labels deterministically and builds the record list.
+ * Entries are ordered by (label, dns_label before hostname, peer id, ip); the
+ * first keeps the label and later ones get the lowest free "-N" suffix, so
+ * the peer NetBird assigned a dns_label to keeps it, and a real peer named
+ * "nas-1" always wins over a generated one. Takes ownership of every
+ * ip/peer_id.
+ *
+ * Suffixes are only stable while the set of clashing peers is: if a
+ * lower-sorting duplicate goes away, the next refresh hands its name (and
+ * the following suffixes) to other peers, so "nas-2" can point at a
+ * different host for up to one TTL.
+ */
+static nb_record_t *nb_build_records(nb_state_t *state, nb_pending_t *pending, size_t count) {
+    nb_record_t *head = NULL;
+
+    qsort(pending, count, sizeof(nb_pending_t), nb_pending_cmp);
+
+    // Mark before renaming anything: only the first entry of a run keeps the name
+    for (size_t i = 0; i < count; i++) {
+        pending[i].duplicate = i > 0 && strcmp(pending[i].label, pending[i - 1].label) == 0;
+    }
+
+    // Real names go in first so generated ones can never take them
+    nb_label_set_t taken;
+    int have_set = nb_label_set_init(&taken, count) == 0;
+    for (size_t i = 0; have_set && i < count; i++) {
+        if (!pending[i].duplicate) nb_label_set_add(&taken, pending[i].label);
+    }
+
+    // Duplicates of one base are adjacent, so the next suffix to try only
+    // moves forward within a run: O(1) expected per entry
+    unsigned next_suffix = 1;
+    for (size_t i = 0; i < count; i++) {
+        if (!pending[i].duplicate) {
+            next_suffix = 1;
+            continue;
+        }
+
+        char base[NB_LABEL_MAX + 1];
+        memcpy(base, pending[i].label, sizeof(base));
+
+        if (!have_set) {
+            nb_log(state, NB_LOG_ERROR, "Netbird DLZ: Out of memory, dropping duplicate name '%s'", base);
+            pending[i].label[0] = '\0';
+            continue;
+        }
+
+        for (;; next_suffix++) {
+            char suffix[16];
+            int slen = snprintf(suffix, sizeof(suffix), "-%u", next_suffix);
+            size_t blen = strlen(base);
+            if (blen + (size_t)slen > NB_LABEL_MAX) blen = NB_LABEL_MAX - (size_t)slen;
+            while (blen > 0 && base[blen - 1] == '-') blen--;
+
+            snprintf(pending[i].label, sizeof(pending[i].label), "%.*s%s", (int)blen, base, suffix);
+            if (nb_label_set_add(&taken, pending[i].label)) {
+                nb_log(state, NB_LOG_WARNING, "Netbird DLZ: Duplicate name '%s' (peer %s) served as '%s'",
+                       base, pending[i].peer_id ? pending[i].peer_id : "?", pending[i].label);
+                next_suffix++;
+                break;
+            }
+        }
+    }
+    if (have_set) free(taken.slots);
+
+    // Build in reverse so the list keeps the sorted order
+    for (size_t i = count; i-- > 0;) {
+        nb_record_t *node = pending[i].label[0] ? malloc(sizeof(nb_record_t)) : NULL;
+        char *hostname = node ? strdup(pending[i].label) : NULL;
+        if (!hostname) {
+            free(node);
+            free(pending[i].ip);
+        } else {
+            node->hostname = hostname;
+            node->hostname_len = strlen(hostname);
+            node->ip = pending[i].ip;
+            node->next = head;
+            head = node;
+            nb_log(state, NB_LOG_INFO, "Netbird DLZ: Loaded record name='%s' ip='%s'", node->hostname, node->ip);
+        }
+        free(pending[i].peer_id);
+        pending[i].ip = NULL;
+        pending[i].peer_id = NULL;
+    }
+
+    return head;
+}
+
 /******************************************************************************
  * JSON ENGINE & BACKGROUND THREAD
  ******************************************************************************/
@@ -145,14 +473,14 @@ static void fetch_and_update(nb_state_t *state) {
         goto cleanup;
     }
 
-    // DEBUG: Dump JSON to /tmp/netbird_debug.json for inspection
-    FILE *debug_fp = fopen("/tmp/netbird_debug.json", "w");
+    // DEBUG: Dump JSON to NB_DEBUG_DUMP_PATH for inspection
+    FILE *debug_fp = fopen(NB_DEBUG_DUMP_PATH, "w");
     if (debug_fp) {
         if (chunk.ptr) {
             fputs(chunk.ptr, debug_fp);
         }
         fclose(debug_fp);
-        nb_log(state, NB_LOG_INFO, "Netbird DLZ: Debug dump written to /tmp/netbird_debug.json");
+        nb_log(state, NB_LOG_INFO, "Netbird DLZ: Debug dump written to %s", NB_DEBUG_DUMP_PATH);
     }
     
     // Parse JSON
@@ -178,7 +506,9 @@ static void fetch_and_update(nb_state_t *state) {
     size_t array_size = json_array_size(root);
     nb_log(state, NB_LOG_INFO, "Netbird DLZ: JSON array size: %zu", array_size);
 
-    nb_record_t *new_list_head = NULL;
+    nb_pending_t *pending = NULL;
+    size_t pending_count = 0;
+    size_t pending_cap = 0;
 
     nb_log(state, NB_LOG_INFO, "Debug: sizeof(json_t)=%zu, sizeof(json_type)=%zu", sizeof(json_t), sizeof(json_type));
 
@@ -198,6 +528,8 @@ static void fetch_and_update(nb_state_t *state) {
         char *ip_str = NULL;
         json_t *chk_host = json_object_get(peer, "hostname");
         json_t *chk_ip = json_object_get(peer, "ip");
+        json_t *chk_label = json_object_get(peer, "dns_label");
+        json_t *chk_id = json_object_get(peer, "id");
         nb_log(state, NB_LOG_INFO, "Debug: Direct Lookup - hostname=%p, ip=%p", (void*)chk_host, (void*)chk_ip);
 
         if (chk_host) {
@@ -282,28 +614,36 @@ static void fetch_and_update(nb_state_t *state) {
 
         /* End of manual iteration */
 
-        if (host_str && ip_str) {
-            nb_record_t *node = malloc(sizeof(nb_record_t));
-            if (!node) {
+        const char *label_str = json_is_string(chk_label) ? json_string_value(chk_label) : NULL;
+
+        if ((host_str || label_str) && ip_str) {
+            if (pending_count == pending_cap) {
+                size_t new_cap = pending_cap ? pending_cap * 2 : 64;
+                nb_pending_t *grown = realloc(pending, new_cap * sizeof(nb_pending_t));
+                if (!grown) {
+                    free(host_str);
+                    free(ip_str);
+                    continue;
+                }
+                pending = grown;
+                pending_cap = new_cap;
+            }
+
+            // Canonicalize once here so dlz_lookup() never has to
+            nb_pending_t *entry = &pending[pending_count];
+            if (nb_canonicalize_label(label_str, host_str, entry->label, sizeof(entry->label),
+                                      &entry->from_dns_label) < 0) {
+                nb_log(state, NB_LOG_WARNING, "Netbird DLZ: Skipping peer with invalid name dns_label='%s' hostname='%s'",
+                       label_str ? label_str : "", host_str ? host_str : "");
                 free(host_str);
                 free(ip_str);
                 continue;
             }
-            
-            node->hostname = host_str;
-            char *dot = strchr(node->hostname, '.');
-            if (dot) *dot = '\0';
-
-            // Sanitize
-            for (char *p = node->hostname; *p; p++) {
-                if (*p == ' ') *p = '-';
-            }
-            node->ip = ip_str;
-
-            nb_log(state, NB_LOG_INFO, "Netbird DLZ: Loaded record name='%s' ip='%s'", node->hostname, node->ip);
-            
-            node->next = new_list_head;
-            new_list_head = node;
+            entry->ip = ip_str;
+            entry->peer_id = json_is_string(chk_id) ? strdup(json_string_value(chk_id)) : NULL;
+            entry->duplicate = 0;
+            pending_count++;
+            free(host_str);
         } else {
             if (host_str) free(host_str);
             if (ip_str) free(ip_str);
@@ -312,6 +652,9 @@ static void fetch_and_update(nb_state_t *state) {
 
     json_decref(root);
 
+    nb_record_t *new_list_head = nb_build_records(state, pending, pending_count);
+    free(pending);
+
     // Atomic Swap
     // "Traffic Light": Ensure BIND isn't reading while we swap pointer
     pthread_rwlock_wrlock(&state->lock);
@@ -383,7 +726,14 @@ isc_result_t dlz_create(const char *dlzname, unsigned int argc, char *argv[],
     state->api_url = (argc >= 4) ? strdup(argv[3]) : strdup("https://api.netbird.io/api/peers");
 
     // Initialize Lock
-    if (pthread_rwlock_init(&state->lock, NULL) != 0) {
+    // Prefer writers: glibc's default lets a steady stream of lookups starve
+    // the cache swap in fetch_and_update() indefinitely.
+    pthread_rwlockattr_t lock_attr;
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    int lock_rc = pthread_rwlock_init(&state->lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
+    if (lock_rc != 0) {
         free(state);
         return ISC_R_FAILURE;
     }
@@ -502,6 +852,14 @@ isc_result_t dlz_lookup(const char *zone, const char *name, void *dbdata,
         return ISC_R_NOTFOUND;
     }
 
+    // Fold the query once; stored names are already canonical lowercase labels
+    char key[NB_LABEL_MAX + 1];
+    size_t key_len = nb_fold_query(name, key, sizeof(key));
+    if (key_len == 0) {
+        nb_log(state, NB_LOG_INFO, "Lookup failed: '%s' is empty, multi-label or longer than a DNS label", name);
+        return ISC_R_NOTFOUND;
+    }
+
     // Acquire Read Lock (allows concurrent lookups)
     pthread_rwlock_rdlock(&state->lock);
 
@@ -509,8 +867,7 @@ isc_result_t dlz_lookup(const char *zone, const char *name, void *dbdata,
     int record_count = 0;
     while (curr != NULL) {
         record_count++;
-        nb_log(state, NB_LOG_INFO, "Debug compare: '%s' vs '%s'", curr->hostname, name);
-        if (strcasecmp(curr->hostname, name) == 0) {
+        if (curr->hostname_len == key_len && memcmp(curr->hostname, key, key_len) == 0) {
             // Found it! Inject result directly into BIND packet.
             nb_log(state, NB_LOG_INFO, "Match found! hostname='%s' ip='%s'", curr->hostname, curr->ip);
             
@@ -0,0 +1,951 @@
+/*
+ * soak_test.c - Long-running churn/soak test for the Netbird DLZ plugin
+ *
+ * Drives the real plugin code (netbird_dlz.c is compiled into this binary)
+ * against an in-process mock Netbird API that churns its peer list on every
+ * request (adds, deletes, IP changes, renames). A refresher thread calls
+ * fetch_and_update() at an accelerated interval while lookup threads hammer
+ * dlz_lookup(). Every report interval it prints RSS, heap usage and
+ * fragmentation, allocation counts and lookup latency percentiles.
+ *
+ * The run fails if:
+ *   - any plugin or Jansson allocation is still live after dlz_destroy()
+ *   - dlz_lookup() returns anything other than SUCCESS/NOTFOUND
+ *   - RSS/heap growth or lookup latency regresses past the stored baseline
+ *
+ * A missing baseline, or one recorded with different run settings (peer
+ * count, threads, refresh interval, duration, churn), is an error (exit 2)
+ * unless --update-baseline is given, in which case the run's results are
+ * written to it instead of being checked.
+ *
+ * Build & run:  make soak  (checks the committed soak_baseline.txt)
+ * Re-record:    make soak-baseline  (same SOAK_ARGS as the run to check)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/utsname.h>
+#include <curl/curl.h>
+#include <jansson.h>
+
+/* BIND 9.18+ DLZ headers (pulled in before the allocator macros below) */
+#include <dns/dlz_dlopen.h>
+#include <dns/sdlz.h>
+#include <isc/result.h>
+
+/******************************************************************************
+ * ALLOCATION ACCOUNTING
+ ******************************************************************************/
+
+/* One set of counters per allocator client */
+typedef struct soak_alloc_stats {
+    atomic_long calls;      // malloc/calloc/realloc/strdup calls
+    atomic_long live;       // blocks currently allocated
+} soak_alloc_stats_t;
+
+static soak_alloc_stats_t plugin_stats;
+static soak_alloc_stats_t json_stats;
+static soak_alloc_stats_t curl_stats;
+
+static void *count_malloc(soak_alloc_stats_t *st, size_t n) {
+    void *p = malloc(n);
+    atomic_fetch_add_explicit(&st->calls, 1, memory_order_relaxed);
+    if (p) atomic_fetch_add_explicit(&st->live, 1, memory_order_relaxed);
+    return p;
+}
+
+static void *count_calloc(soak_alloc_stats_t *st, size_t n, size_t sz) {
+    void *p = calloc(n, sz);
+    atomic_fetch_add_explicit(&st->calls, 1, memory_order_relaxed);
+    if (p) atomic_fetch_add_explicit(&st->live, 1, memory_order_relaxed);
+    return p;
+}
+
+static void *count_realloc(soak_alloc_stats_t *st, void *old, size_t n) {
+    void *p = realloc(old, n);
+    atomic_fetch_add_explicit(&st->calls, 1, memory_order_relaxed);
+    if (!old && p) atomic_fetch_add_explicit(&st->live, 1, memory_order_relaxed);
+    return p;
+}
+
+static char *count_strdup(soak_alloc_stats_t *st, const char *s) {
+    char *p = strdup(s);
+    atomic_fetch_add_explicit(&st->calls, 1, memory_order_relaxed);
+    if (p) atomic_fetch_add_explicit(&st->live, 1, memory_order_relaxed);
+    return p;
+}
+
+static void count_free(soak_alloc_stats_t *st, void *p) {
+    if (!p) return;
+    atomic_fetch_sub_explicit(&st->live, 1, memory_order_relaxed);
+    free(p);
+}
+
+/* Plugin (netbird_dlz.c) */
+static void *soak_plugin_malloc(size_t n) { return count_malloc(&plugin_stats, n); }
+static void *soak_plugin_calloc(size_t n, size_t sz) { return count_calloc(&plugin_stats, n, sz); }
+static void *soak_plugin_realloc(void *p, size_t n) { return count_realloc(&plugin_stats, p, n); }
+static char *soak_plugin_strdup(const char *s) { return count_strdup(&plugin_stats, s); }
+static void soak_plugin_free(void *p) { count_free(&plugin_stats, p); }
+
+/* Jansson (json_set_alloc_funcs) */
+static void *soak_json_malloc(size_t n) { return count_malloc(&json_stats, n); }
+static void soak_json_free(void *p) { count_free(&json_stats, p); }
+
+/* libcurl (curl_global_init_mem) */
+static void *soak_curl_malloc(size_t n) { return count_malloc(&curl_stats, n); }
+static void *soak_curl_calloc(size_t n, size_t sz) { return count_calloc(&curl_stats, n, sz); }
+static void *soak_curl_realloc(void *p, size_t n) { return count_realloc(&curl_stats, p, n); }
+static char *soak_curl_strdup(const char *s) { return count_strdup(&curl_stats, s); }
+static void soak_curl_free(void *p) { count_free(&curl_stats, p); }
+
+/******************************************************************************
+ * PLUGIN UNDER TEST
+ ******************************************************************************/
+
+/* Route the plugin's heap traffic through the plugin counters */
+#undef strdup
+#define malloc(n)     soak_plugin_malloc(n)
+#define calloc(n, sz) soak_plugin_calloc(n, sz)
+#define realloc(p, n) soak_plugin_realloc(p, n)
+#define strdup(s)     soak_plugin_strdup(s)
+#define free(p)       soak_plugin_free(p)
+
+#include "netbird_dlz.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#undef free
+
+/* BIND normally provides this; we just count the answers */
+static atomic_long putrr_calls;
+
+isc_result_t dns_sdlz_putrr(dns_sdlzlookup_t *lookup, const char *type,
+                            dns_ttl_t ttl, const char *data) {
+    (void)lookup;
+    (void)type;
+    (void)ttl;
+    (void)data;
+    atomic_fetch_add_explicit(&putrr_calls, 1, memory_order_relaxed);
+    return ISC_R_SUCCESS;
+}
+
+/******************************************************************************
+ * CONFIGURATION
+ ******************************************************************************/
+#define SOAK_ZONE "bird.soak.test"
+
+typedef struct soak_config {
+    int duration_s;         // total run time
+    int warmup_s;           // samples before this are not used as the RSS reference
+    int report_s;           // report interval
+    int refresh_ms;         // accelerated refresh interval
+    int threads;            // lookup threads
+    int peers;              // initial peer count
+    int adds;               // per refresh
+    int deletes;            // per refresh
+    int ip_changes;         // per refresh
+    int renames;            // per refresh
+    int miss_pct;           // % of lookups for names that never exist
+    double tolerance;       // allowed regression vs baseline (0.25 = +25%)
+    const char *baseline;
+    int update_baseline;
+} soak_config_t;
+
+static soak_config_t cfg = {
+    .duration_s = 300,
+    .warmup_s = 30,
+    .report_s = 10,
+    .refresh_ms = 200,
+    .threads = 4,
+    .peers = 500,
+    .adds = 10,
+    .deletes = 10,
+    .ip_changes = 25,
+    .renames = 10,
+    .miss_pct = 10,
+    .tolerance = 0.25,
+    .baseline = "soak_baseline.txt",
+    .update_baseline = 0,
+};
+
+/******************************************************************************
+ * MOCK NETBIRD API
+ ******************************************************************************/
+
+typedef struct mock_peer {
+    unsigned id;
+    unsigned gen;           // bumped on rename
+    char ip[16];
+} mock_peer_t;
+
+typedef struct mock_api {
+    int listen_fd;
+    unsigned short port;
+    pthread_t thread_id;
+    volatile int stop_flag;
+
+    pthread_mutex_t lock;
+    mock_peer_t *peers;
+    size_t count;
+    size_t cap;
+    unsigned next_id;
+    unsigned seed;
+    long requests;
+} mock_api_t;
+
+static mock_api_t mock;
+
+/* Name as served by the API; mixed case so lookups exercise case folding */
+static int mock_peer_name(const mock_peer_t *p, char *buf, size_t len) {
+    if (p->gen) return snprintf(buf, len, "Peer-%u-r%u", p->id, p->gen);
+    return snprintf(buf, len, "Peer-%u", p->id);
+}
+
+/* Lowercased name, i.e. what a DNS query for the peer looks like */
+static void mock_peer_label(const mock_peer_t *p, char *buf, size_t len) {
+    mock_peer_name(p, buf, len);
+    for (char *c = buf; *c; c++) {
+        if (*c >= 'A' && *c <= 'Z') *c += 'a' - 'A';
+    }
+}
+
+static void mock_random_ip(char *buf, size_t len, unsigned *seed) {
+    unsigned b = 64 + (unsigned)rand_r(seed) % 64;
+    unsigned c = (unsigned)rand_r(seed) % 256;
+    unsigned d = 1 + (unsigned)rand_r(seed) % 254;
+    snprintf(buf, len, "100.%u.%u.%u", b & 0xff, c & 0xff, d & 0xff);
+}
+
+static void mock_add_peer(void) {
+    if (mock.count == mock.cap) {
+        size_t cap = mock.cap ? mock.cap * 2 : 64;
+        mock_peer_t *p = realloc(mock.peers, cap * sizeof(*p));
+        if (!p) return;
+        mock.peers = p;
+        mock.cap = cap;
+    }
+    mock_peer_t *p = &mock.peers[mock.count++];
+    p->id = mock.next_id++;
+    p->gen = 0;
+    mock_random_ip(p->ip, sizeof(p->ip), &mock.seed);
+}
+
+/* Applies one refresh worth of churn. Caller holds mock.lock. */
+static void mock_churn(void) {
+    for (int i = 0; i < cfg.deletes && mock.count > 0; i++) {
+        size_t victim = rand_r(&mock.seed) % mock.count;
+        mock.peers[victim] = mock.peers[--mock.count];
+    }
+    for (int i = 0; i < cfg.adds; i++) {
+        mock_add_peer();
+    }
+    for (int i = 0; i < cfg.ip_changes && mock.count > 0; i++) {
+        mock_peer_t *p = &mock.peers[rand_r(&mock.seed) % mock.count];
+        mock_random_ip(p->ip, sizeof(p->ip), &mock.seed);
+    }
+    for (int i = 0; i < cfg.renames && mock.count > 0; i++) {
+        mock.peers[rand_r(&mock.seed) % mock.count].gen++;
+    }
+}
+
+/* Builds the /api/peers response body. Caller holds mock.lock. */
+static char *mock_render(size_t *out_len) {
+    size_t cap = 256 + mock.count * 192;
+    char *body = malloc(cap);
+    if (!body) return NULL;
+
+    size_t len = 0;
+    body[len++] = '[';
+    for (size_t i = 0; i < mock.count; i++) {
+        const mock_peer_t *p = &mock.peers[i];
+        char name[64], label[64];
+        mock_peer_name(p, name, sizeof(name));
+        mock_peer_label(p, label, sizeof(label));
+
+        for (;;) {
+            // Leave room for the closing "]\0"
+            int n = snprintf(body + len, cap - len - 2,
+                "%s{\"id\":\"peer%u\",\"name\":\"%s\",\"hostname\":\"%s\","
+                "\"ip\":\"%s\",\"dns_label\":\"%s.netbird.cloud\","
+                "\"connected\":true}",
+                i ? "," : "", p->id, name, name, p->ip, label);
+            if (n < 0) {
+                free(body);
+                return NULL;
+            }
+            if ((size_t)n < cap - len - 2) {
+                len += (size_t)n;
+                break;
+            }
+            // Estimate was short (ids and rename suffixes grow on long runs)
+            char *grown = realloc(body, cap * 2 + (size_t)n);
+            if (!grown) {
+                free(body);
+                return NULL;
+            }
+            body = grown;
+            cap = cap * 2 + (size_t)n;
+        }
+    }
+    body[len++] = ']';
+    body[len] = '\0';
+    *out_len = len;
+    return body;
+}
+
+static void mock_serve(int fd) {
+    char req[4096];
+    size_t got = 0;
+
+    // Drain the request headers; we answer every request with the peer list
+    while (got < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + got, sizeof(req) - 1 - got, 0);
+        if (n <= 0) return;
+        got += (size_t)n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+
+    pthread_mutex_lock(&mock.lock);
+    mock_churn();
+    mock.requests++;
+    size_t body_len = 0;
+    char *body = mock_render(&body_len);
+    pthread_mutex_unlock(&mock.lock);
+    if (!body) return;
+
+    char hdr[256];
+    int hdr_len = snprintf(hdr, sizeof(hdr),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+        "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+
+    if (send(fd, hdr, (size_t)hdr_len, MSG_NOSIGNAL) == hdr_len) {
+        size_t sent = 0;
+        while (sent < body_len) {
+            ssize_t n = send(fd, body + sent, body_len - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += (size_t)n;
+        }
+    }
+    free(body);
+}
+
+static void *mock_thread(void *arg) {
+    (void)arg;
+    struct pollfd pfd = { .fd = mock.listen_fd, .events = POLLIN };
+
+    while (!mock.stop_flag) {
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        int fd = accept(mock.listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        mock_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int mock_start(void) {
+    pthread_mutex_init(&mock.lock, NULL);
+    mock.seed = 0x5eed;
+    mock.next_id = 1;
+    for (int i = 0; i < cfg.peers; i++) {
+        mock_add_peer();
+    }
+
+    mock.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (mock.listen_fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(mock.listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;  // ephemeral
+    socklen_t alen = sizeof(addr);
+
+    if (bind(mock.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(mock.listen_fd, 16) != 0 ||
+        getsockname(mock.listen_fd, (struct sockaddr *)&addr, &alen) != 0) {
+        close(mock.listen_fd);
+        return -1;
+    }
+    mock.port = ntohs(addr.sin_port);
+
+    if (pthread_create(&mock.thread_id, NULL, mock_thread, NULL) != 0) {
+        close(mock.listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void mock_stop(void) {
+    mock.stop_flag = 1;
+    pthread_join(mock.thread_id, NULL);
+    close(mock.listen_fd);
+    free(mock.peers);
+    pthread_mutex_destroy(&mock.lock);
+}
+
+/******************************************************************************
+ * LATENCY HISTOGRAM
+ ******************************************************************************/
+
+/* Log-linear buckets: 8 sub-buckets per power of two, exact below 8ns */
+#define HIST_BUCKETS 496
+
+typedef struct hist {
+    atomic_ulong b[HIST_BUCKETS];
+} hist_t;
+
+static int hist_bucket(uint64_t ns) {
+    if (ns < 8) return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (e - 3)) & 7);
+    return (e - 2) * 8 + sub;
+}
+
+static uint64_t hist_value(int b) {
+    if (b < 8) return (uint64_t)b;
+    int e = b / 8 + 2;
+    return (uint64_t)(8 + b % 8) << (e - 3);
+}
+
+/* Returns the lower bound of the bucket holding percentile pct (0..100) */
+static uint64_t hist_percentile(const unsigned long *b, unsigned long total, double pct) {
+    if (total == 0) return 0;
+    unsigned long rank = (unsigned long)((pct / 100.0) * (double)(total - 1));
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += b[i];
+        if (seen > rank) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+/******************************************************************************
+ * WORKER THREADS
+ ******************************************************************************/
+
+static volatile int soak_stop;
+static nb_state_t *soak_db;
+static atomic_long refresh_cycles;
+
+typedef struct lookup_worker {
+    pthread_t thread_id;
+    unsigned seed;
+    hist_t window;          // drained by the reporter every interval
+    atomic_long hits;
+    atomic_long misses;
+    atomic_long failures;
+} lookup_worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *refresh_thread(void *arg) {
+    (void)arg;
+    struct timespec ts = {
+        .tv_sec = cfg.refresh_ms / 1000,
+        .tv_nsec = (long)(cfg.refresh_ms % 1000) * 1000000L,
+    };
+    while (!soak_stop) {
+        fetch_and_update(soak_db);
+        atomic_fetch_add_explicit(&refresh_cycles, 1, memory_order_relaxed);
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+static void *lookup_thread(void *arg) {
+    lookup_worker_t *w = (lookup_worker_t *)arg;
+    static char fake_lookup;  // dlz_lookup() rejects a NULL handle
+    char name[64];
+
+    while (!soak_stop) {
+        // Pick the name outside the timed region
+        if ((int)(rand_r(&w->seed) % 100) < cfg.miss_pct) {
+            snprintf(name, sizeof(name), "nohost-%u", rand_r(&w->seed));
+        } else {
+            pthread_mutex_lock(&mock.lock);
+            if (mock.count > 0) {
+                mock_peer_t p = mock.peers[rand_r(&w->seed) % mock.count];
+                pthread_mutex_unlock(&mock.lock);
+                mock_peer_label(&p, name, sizeof(name));
+            } else {
+                pthread_mutex_unlock(&mock.lock);
+                snprintf(name, sizeof(name), "peer-0");
+            }
+        }
+
+        uint64_t t0 = now_ns();
+        isc_result_t r = dlz_lookup(SOAK_ZONE, name, soak_db,
+                                    (dns_sdlzlookup_t *)&fake_lookup, NULL, NULL);
+        uint64_t dt = now_ns() - t0;
+
+        atomic_fetch_add_explicit(&w->window.b[hist_bucket(dt)], 1, memory_order_relaxed);
+        if (r == ISC_R_SUCCESS) {
+            atomic_fetch_add_explicit(&w->hits, 1, memory_order_relaxed);
+        } else if (r == ISC_R_NOTFOUND) {
+            atomic_fetch_add_explicit(&w->misses, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&w->failures, 1, memory_order_relaxed);
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * SAMPLING & BASELINE
+ ******************************************************************************/
+
+typedef struct soak_sample {
+    long rss_kb;
+    long heap_inuse_kb;
+    long heap_free_kb;
+    long heap_arena_kb;
+} soak_sample_t;
+
+static void take_sample(soak_sample_t *s) {
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(fp);
+    }
+    s->rss_kb = resident * (sysconf(_SC_PAGESIZE) / 1024);
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    s->heap_inuse_kb = (long)mi.uordblks / 1024;
+    s->heap_free_kb = (long)mi.fordblks / 1024;
+    s->heap_arena_kb = (long)mi.arena / 1024;
+}
+
+/* Metrics compared against the baseline file; lower is better for all */
+typedef struct soak_result {
+    long rss_growth_kb;
+    long heap_growth_kb;
+    long p99_ns;
+    long p999_ns;
+} soak_result_t;
+
+static const struct {
+    const char *key;
+    size_t offset;
+    long slack;             // absolute noise allowance on top of the tolerance
+} result_fields[] = {
+    { "rss_growth_kb",  offsetof(soak_result_t, rss_growth_kb),  2048 },
+    { "heap_growth_kb", offsetof(soak_result_t, heap_growth_kb), 1024 },
+    { "p99_ns",         offsetof(soak_result_t, p99_ns),         2000 },
+    { "p999_ns",        offsetof(soak_result_t, p999_ns),        10000 },
+};
+#define RESULT_FIELD(r, i) (*(long *)((char *)(r) + result_fields[i].offset))
+#define NUM_RESULT_FIELDS (sizeof(result_fields) / sizeof(result_fields[0]))
+
+/* Run settings a baseline is only valid for; recorded in its header line */
+#define BASELINE_HEADER "# netbird_dlz soak baseline:"
+
+static const struct {
+    const char *key;
+    const int *value;
+} setting_fields[] = {
+    { "peers",      &cfg.peers },
+    { "threads",    &cfg.threads },
+    { "refresh_ms", &cfg.refresh_ms },
+    { "duration_s", &cfg.duration_s },
+    { "adds",       &cfg.adds },
+    { "deletes",    &cfg.deletes },
+    { "ip_changes", &cfg.ip_changes },
+    { "renames",    &cfg.renames },
+    { "miss_pct",   &cfg.miss_pct },
+};
+#define NUM_SETTING_FIELDS (sizeof(setting_fields) / sizeof(setting_fields[0]))
+
+/*
+ * Checks the header's key=value settings against this run. Returns 0 if they
+ * all match, -1 (after printing the first difference) otherwise.
+ */
+static int check_baseline_settings(const char *path, const char *header) {
+    int found = 0;
+    const char *p = header + strlen(BASELINE_HEADER);
+    char key[32];
+    int val, used;
+
+    while (sscanf(p, " %31[^=]=%d%n", key, &val, &used) == 2) {
+        p += used;
+        for (size_t i = 0; i < NUM_SETTING_FIELDS; i++) {
+            if (strcmp(key, setting_fields[i].key) != 0) continue;
+            if (val != *setting_fields[i].value) {
+                fprintf(stderr, "soak: baseline %s was recorded with %s=%d, this run uses %d\n",
+                        path, key, val, *setting_fields[i].value);
+                return -1;
+            }
+            found++;
+        }
+    }
+    if (found != (int)NUM_SETTING_FIELDS) {
+        fprintf(stderr, "soak: baseline %s does not record all run settings\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Loads the baseline for the current settings. Returns 0 on success, -1 if the
+ * file is missing or incomplete, -2 if it was recorded with other settings.
+ */
+static int load_baseline(const char *path, soak_result_t *out) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    char line[512], key[64];
+    long val;
+    int found = 0;
+    int settings = -1;
+    int seen_header = 0;
+    memset(out, 0, sizeof(*out));
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, BASELINE_HEADER, strlen(BASELINE_HEADER)) == 0) {
+            settings = check_baseline_settings(path, line);
+            seen_header = 1;
+            continue;
+        }
+        if (line[0] == '#' || sscanf(line, "%63s %ld", key, &val) != 2) continue;
+        for (size_t i = 0; i < NUM_RESULT_FIELDS; i++) {
+            if (strcmp(key, result_fields[i].key) == 0) {
+                RESULT_FIELD(out, i) = val;
+                found++;
+            }
+        }
+    }
+    fclose(fp);
+    if (found > 0 && settings == -1 && !seen_header) {
+        fprintf(stderr, "soak: baseline %s has no run settings header\n", path);
+    }
+    if (found > 0 && settings != 0) return -2;
+    return found == (int)NUM_RESULT_FIELDS ? 0 : -1;
+}
+
+static int save_baseline(const char *path, const soak_result_t *r) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    fprintf(fp, "%s", BASELINE_HEADER);
+    for (size_t i = 0; i < NUM_SETTING_FIELDS; i++) {
+        fprintf(fp, " %s=%d", setting_fields[i].key, *setting_fields[i].value);
+    }
+    fprintf(fp, "\n");
+
+    // Latency limits only mean something on comparable hardware
+    struct utsname un;
+    if (uname(&un) == 0) {
+        fprintf(fp, "# recorded on: %s %s, %ld CPUs\n", un.sysname, un.machine,
+                sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    for (size_t i = 0; i < NUM_RESULT_FIELDS; i++) {
+        fprintf(fp, "%s %ld\n", result_fields[i].key, RESULT_FIELD(r, i));
+    }
+    fclose(fp);
+    return 0;
+}
+
+/******************************************************************************
+ * MAIN
+ ******************************************************************************/
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --duration S        total run time (default %d)\n"
+        "  --warmup S          RSS/heap reference point (default %d)\n"
+        "  --report S          report interval (default %d)\n"
+        "  --refresh-ms MS     refresh interval (default %d)\n"
+        "  --threads N         lookup threads (default %d)\n"
+        "  --peers N           initial peer count (default %d)\n"
+        "  --adds N            peers added per refresh (default %d)\n"
+        "  --deletes N         peers deleted per refresh (default %d)\n"
+        "  --ip-changes N      IP changes per refresh (default %d)\n"
+        "  --renames N         renames per refresh (default %d)\n"
+        "  --miss-pct N        %% of lookups for unknown names (default %d)\n"
+        "  --tolerance F       allowed regression vs baseline (default %.2f)\n"
+        "  --baseline PATH     baseline file (default %s)\n"
+        "  --update-baseline   overwrite the baseline with this run\n",
+        prog, cfg.duration_s, cfg.warmup_s, cfg.report_s, cfg.refresh_ms,
+        cfg.threads, cfg.peers, cfg.adds, cfg.deletes, cfg.ip_changes,
+        cfg.renames, cfg.miss_pct, cfg.tolerance, cfg.baseline);
+}
+
+static int parse_args(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        { "duration",        required_argument, NULL, 'd' },
+        { "warmup",          required_argument, NULL, 'w' },
+        { "report",          required_argument, NULL, 'r' },
+        { "refresh-ms",      required_argument, NULL, 'f' },
+        { "threads",         required_argument, NULL, 't' },
+        { "peers",           required_argument, NULL, 'p' },
+        { "adds",            required_argument, NULL, 'a' },
+        { "deletes",         required_argument, NULL, 'x' },
+        { "ip-changes",      required_argument, NULL, 'i' },
+        { "renames",         required_argument, NULL, 'n' },
+        { "miss-pct",        required_argument, NULL, 'm' },
+        { "tolerance",       required_argument, NULL, 'T' },
+        { "baseline",        required_argument, NULL, 'b' },
+        { "update-baseline", no_argument,       NULL, 'u' },
+        { "help",            no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'd': cfg.duration_s = atoi(optarg); break;
+        case 'w': cfg.warmup_s = atoi(optarg); break;
+        case 'r': cfg.report_s = atoi(optarg); break;
+        case 'f': cfg.refresh_ms = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'p': cfg.peers = atoi(optarg); break;
+        case 'a': cfg.adds = atoi(optarg); break;
+        case 'x': cfg.deletes = atoi(optarg); break;
+        case 'i': cfg.ip_changes = atoi(optarg); break;
+        case 'n': cfg.renames = atoi(optarg); break;
+        case 'm': cfg.miss_pct = atoi(optarg); break;
+        case 'T': cfg.tolerance = atof(optarg); break;
+        case 'b': cfg.baseline = optarg; break;
+        case 'u': cfg.update_baseline = 1; break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (cfg.duration_s <= 0 || cfg.report_s <= 0 || cfg.refresh_ms <= 0 ||
+        cfg.threads <= 0 || cfg.peers < 0 || cfg.warmup_s >= cfg.duration_s) {
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) != 0) return 2;
+
+    // Check the baseline up front rather than after a long run
+    soak_result_t base;
+    if (!cfg.update_baseline) {
+        int rc = load_baseline(cfg.baseline, &base);
+        if (rc == -1) {
+            fprintf(stderr, "soak: no baseline at %s; run with --update-baseline to record one\n",
+                    cfg.baseline);
+        } else if (rc == -2) {
+            fprintf(stderr, "soak: use --baseline PATH for these settings, or --update-baseline\n");
+        }
+        if (rc != 0) return 2;
+    }
+
+    // Hook allocators before anything touches Jansson or libcurl
+    json_set_alloc_funcs(soak_json_malloc, soak_json_free);
+    if (curl_global_init_mem(CURL_GLOBAL_ALL, soak_curl_malloc, soak_curl_free,
+                             soak_curl_realloc, soak_curl_strdup,
+                             soak_curl_calloc) != CURLE_OK) {
+        fprintf(stderr, "soak: curl_global_init_mem failed\n");
+        return 2;
+    }
+
+    if (mock_start() != 0) {
+        fprintf(stderr, "soak: mock API failed to start: %s\n", strerror(errno));
+        return 2;
+    }
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/api/peers", mock.port);
+    char *dlz_argv[] = { "dlopen", SOAK_ZONE, "soak-api-key", url };
+    void *db = NULL;
+    if (dlz_create("netbird", 4, dlz_argv, &db, NULL) != ISC_R_SUCCESS) {
+        fprintf(stderr, "soak: dlz_create failed\n");
+        mock_stop();
+        return 2;
+    }
+    soak_db = (nb_state_t *)db;
+
+    printf("soak: mock API on port %u, %d peers, churn +%d/-%d ip=%d rename=%d per refresh\n",
+           mock.port, cfg.peers, cfg.adds, cfg.deletes, cfg.ip_changes, cfg.renames);
+    printf("soak: refresh every %dms, %d lookup threads, %ds run (%ds warmup)\n",
+           cfg.refresh_ms, cfg.threads, cfg.duration_s, cfg.warmup_s);
+
+    // Prime the cache so lookups measure the steady state, not the empty list
+    fetch_and_update(soak_db);
+    if (soak_db->records == NULL && cfg.peers > 0) {
+        fprintf(stderr, "soak: initial fetch from the mock API loaded no records\n");
+        dlz_destroy(db);
+        mock_stop();
+        return 2;
+    }
+
+    lookup_worker_t *workers = calloc((size_t)cfg.threads, sizeof(*workers));
+    if (!workers) return 2;
+
+    pthread_t refresher;
+    pthread_create(&refresher, NULL, refresh_thread, NULL);
+    for (int i = 0; i < cfg.threads; i++) {
+        workers[i].seed = 0x1000u + (unsigned)i;
+        pthread_create(&workers[i].thread_id, NULL, lookup_thread, &workers[i]);
+    }
+
+    printf("%6s %7s %9s %9s %9s %6s %9s %9s %9s %10s %8s %8s %8s\n",
+           "t(s)", "cycles", "rss(KB)", "heap(KB)", "free(KB)", "frag%",
+           "plug.live", "json.live", "curl.live", "allocs/s",
+           "p50(ns)", "p99(ns)", "p999(ns)");
+
+    unsigned long *window = calloc(HIST_BUCKETS, sizeof(unsigned long));
+    unsigned long *total = calloc(HIST_BUCKETS, sizeof(unsigned long));
+    if (!window || !total) return 2;
+
+    soak_sample_t warm = {0}, sample = {0};
+    int have_warm = 0;
+    long worst_p99 = 0, worst_p999 = 0;
+    long prev_calls = 0;
+
+    for (int t = cfg.report_s; t <= cfg.duration_s; t += cfg.report_s) {
+        sleep((unsigned)cfg.report_s);
+
+        unsigned long n = 0;
+        memset(window, 0, HIST_BUCKETS * sizeof(unsigned long));
+        for (int i = 0; i < cfg.threads; i++) {
+            for (int b = 0; b < HIST_BUCKETS; b++) {
+                unsigned long v = atomic_exchange_explicit(&workers[i].window.b[b], 0,
+                                                           memory_order_relaxed);
+                window[b] += v;
+                total[b] += v;
+                n += v;
+            }
+        }
+
+        take_sample(&sample);
+        if (!have_warm && t >= cfg.warmup_s) {
+            warm = sample;
+            have_warm = 1;
+        }
+
+        long calls = atomic_load(&plugin_stats.calls) + atomic_load(&json_stats.calls) +
+                     atomic_load(&curl_stats.calls);
+        long p99 = (long)hist_percentile(window, n, 99.0);
+        long p999 = (long)hist_percentile(window, n, 99.9);
+        if (have_warm) {
+            if (p99 > worst_p99) worst_p99 = p99;
+            if (p999 > worst_p999) worst_p999 = p999;
+        }
+
+        printf("%6d %7ld %9ld %9ld %9ld %5.1f%% %9ld %9ld %9ld %10ld %8lu %8ld %8ld\n",
+               t, atomic_load(&refresh_cycles), sample.rss_kb,
+               sample.heap_inuse_kb, sample.heap_free_kb,
+               sample.heap_arena_kb ? 100.0 * (double)sample.heap_free_kb / (double)sample.heap_arena_kb : 0.0,
+               atomic_load(&plugin_stats.live), atomic_load(&json_stats.live),
+               atomic_load(&curl_stats.live), (calls - prev_calls) / cfg.report_s,
+               (unsigned long)hist_percentile(window, n, 50.0), p99, p999);
+        fflush(stdout);
+        prev_calls = calls;
+    }
+
+    soak_stop = 1;
+    pthread_join(refresher, NULL);
+    long hits = 0, misses = 0, failures = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        pthread_join(workers[i].thread_id, NULL);
+        hits += atomic_load(&workers[i].hits);
+        misses += atomic_load(&workers[i].misses);
+        failures += atomic_load(&workers[i].failures);
+    }
+
+    dlz_destroy(db);
+    mock_stop();
+
+    soak_result_t res = {
+        .rss_growth_kb = sample.rss_kb - warm.rss_kb,
+        .heap_growth_kb = sample.heap_inuse_kb - warm.heap_inuse_kb,
+        .p99_ns = worst_p99,
+        .p999_ns = worst_p999,
+    };
+
+    unsigned long lookups = (unsigned long)(hits + misses + failures);
+    unsigned long timed = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        timed += total[b];
+    }
+    printf("\nsoak: %ld refreshes (%ld API requests), %lu lookups (%ld hit, %ld miss, %ld failed)\n",
+           atomic_load(&refresh_cycles), mock.requests, lookups, hits, misses, failures);
+    printf("soak: overall latency p50=%luns p99=%luns p999=%luns max>=%luns\n",
+           (unsigned long)hist_percentile(total, timed, 50.0),
+           (unsigned long)hist_percentile(total, timed, 99.0),
+           (unsigned long)hist_percentile(total, timed, 99.9),
+           (unsigned long)hist_percentile(total, timed, 100.0));
+    printf("soak: rss growth %ldKB, heap growth %ldKB since warmup; worst window p99=%ldns p999=%ldns\n",
+           res.rss_growth_kb, res.heap_growth_kb, res.p99_ns, res.p999_ns);
+
+    int failed = 0;
+
+    // Everything the plugin and Jansson allocated must be gone after destroy
+    long plugin_live = atomic_load(&plugin_stats.live);
+    long json_live = atomic_load(&json_stats.live);
+    if (plugin_live != 0 || json_live != 0) {
+        printf("FAIL: leaked allocations after dlz_destroy: plugin=%ld jansson=%ld\n",
+               plugin_live, json_live);
+        failed = 1;
+    }
+    if (failures != 0) {
+        printf("FAIL: %ld lookups returned an error\n", failures);
+        failed = 1;
+    }
+    if (atomic_load(&refresh_cycles) == 0 || hits == 0) {
+        printf("FAIL: no refreshes or no successful lookups; the plugin never loaded data\n");
+        failed = 1;
+    }
+
+    if (!cfg.update_baseline) {
+        for (size_t i = 0; i < NUM_RESULT_FIELDS; i++) {
+            long cur = RESULT_FIELD(&res, i);
+            long ref = RESULT_FIELD(&base, i);
+            long limit = (long)((double)(ref > 0 ? ref : 0) * (1.0 + cfg.tolerance)) +
+                         result_fields[i].slack;
+            int over = cur > limit;
+            printf("%s: %-15s %10ld (baseline %ld, limit %ld)\n",
+                   over ? "FAIL" : "ok  ", result_fields[i].key, cur, ref, limit);
+            if (over) failed = 1;
+        }
+    } else if (!failed) {
+        if (save_baseline(cfg.baseline, &res) == 0) {
+            printf("soak: baseline written to %s\n", cfg.baseline);
+        } else {
+            printf("soak: could not write baseline %s: %s\n", cfg.baseline, strerror(errno));
+        }
+    }
+
+    curl_global_cleanup();
+    free(window);
+    free(total);
+    free(workers);
+
+    printf("soak: %s\n", failed ? "FAILED" : "PASSED");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * test_canon.c - Regression tests for ingest-time name canonicalization
+ *
+ * Covers IDNA/punycode vectors, reserved and malformed A-labels, invalid
+ * UTF-8, the 63-character label limit, suffix truncation and deterministic
+ * duplicate resolution.
+ *
+ * Build & run:  make test
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netbird_dlz.c"
+
+/* BIND normally provides this; unused by the tests */
+isc_result_t dns_sdlz_putrr(dns_sdlzlookup_t *lookup, const char *type,
+                            dns_ttl_t ttl, const char *data) {
+    (void)lookup;
+    (void)type;
+    (void)ttl;
+    (void)data;
+    return ISC_R_SUCCESS;
+}
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+/* Expects hostname (no dns_label) to fold to want, or to be rejected if want is NULL */
+static void check_fold(const char *hostname, const char *want) {
+    char out[NB_LABEL_MAX + 1];
+    int len = nb_canonicalize_label(NULL, hostname, out, sizeof(out), NULL);
+    if (want == NULL) {
+        CHECK(len < 0, "'%s' should be rejected, got '%s'", hostname, out);
+    } else {
+        CHECK(len >= 0 && strcmp(out, want) == 0 && (size_t)len == strlen(want),
+              "'%s' -> '%s', want '%s'", hostname, len < 0 ? "<invalid>" : out, want);
+    }
+}
+
+static void test_punycode(void) {
+    check_fold("Büro", "xn--bro-hoa");
+    check_fold("München", "xn--mnchen-3ya");
+    check_fold("bücher", "xn--bcher-kva");
+    check_fold("日本語", "xn--wgv71a119e");
+    check_fold("Büro.local", "xn--bro-hoa");   // first label only
+    check_fold("BÜRO", "xn--bro-hoa");         // UTS #46 case folding
+    check_fold("Straße", "xn--strae-oqa");     // nontransitional: ß is kept
+    check_fold("John\xe2\x80\x99s MacBook", NULL); // U+2019 is DISALLOWED in IDNA2008
+}
+
+static void test_ascii_labels(void) {
+    check_fold("xn--bro-hoa", "xn--bro-hoa");
+    check_fold("XN--BRO-HOA", "xn--bro-hoa");
+    check_fold("xn--abc", NULL);               // does not decode
+    check_fold("xn--bro-tka", NULL);           // decodes to "bÜro", not a valid U-label
+    check_fold("ab--cd", NULL);                // hyphens in 3-4 reserved (RFC 5891)
+    check_fold("a--b", "a--b");
+}
+
+static void test_ascii_folding(void) {
+    check_fold("IndigoStation", "indigostation");
+    check_fold("nas.example.com", "nas");
+    check_fold("My Laptop", "my-laptop");
+    check_fold("John's MacBook", "john-s-macbook");
+    check_fold("under_score", "under-score");
+    check_fold("foo - bar", "foo-bar");
+    check_fold("ab---", "ab");
+    check_fold("-edge_", "edge");
+    check_fold("!!!", NULL);
+    check_fold("", NULL);
+
+    // dns_label wins over hostname; hostname is the fallback
+    char out[NB_LABEL_MAX + 1];
+    int from_dns_label = -1;
+    CHECK(nb_canonicalize_label("nas-2.netbird.cloud", "NAS", out, sizeof(out), &from_dns_label) >= 0 &&
+          strcmp(out, "nas-2") == 0 && from_dns_label == 1, "dns_label not preferred, got '%s'", out);
+    CHECK(nb_canonicalize_label("", "NAS", out, sizeof(out), &from_dns_label) >= 0 &&
+          strcmp(out, "nas") == 0 && from_dns_label == 0, "hostname fallback failed, got '%s'", out);
+    CHECK(nb_canonicalize_label("ab--cd.netbird.cloud", "NAS", out, sizeof(out), &from_dns_label) >= 0 &&
+          strcmp(out, "nas") == 0 && from_dns_label == 0, "invalid dns_label not skipped, got '%s'", out);
+}
+
+static void test_invalid_utf8(void) {
+    check_fold("\xff", NULL);                  // not a lead byte
+    check_fold("B\xc3", NULL);                 // truncated sequence
+    check_fold("\xc0\xaf", NULL);              // overlong '/'
+    check_fold("\xed\xa0\x80", NULL);          // UTF-16 surrogate
+    check_fold("\xf4\x90\x80\x80", NULL);      // above U+10FFFF
+}
+
+static void test_label_limit(void) {
+    char name[80];
+    memset(name, 'a', 63);
+    name[63] = '\0';
+    check_fold(name, name);
+
+    memset(name, 'a', 64);
+    name[64] = '\0';
+    check_fold(name, NULL);
+
+    // Trailing separators are trimmed before the limit applies
+    char want[80];
+    memset(want, 'a', 63);
+    want[63] = '\0';
+    memset(name, 'a', 63);
+    memcpy(name + 63, " ", 2);
+    check_fold(name, want);
+    memcpy(name + 63, "__--", 5);
+    check_fold(name, want);
+}
+
+static nb_record_t *build(nb_pending_t *pending, size_t count) {
+    nb_state_t state = {0};
+    return nb_build_records(&state, pending, count);
+}
+
+static void set_pending(nb_pending_t *p, const char *label, const char *ip, const char *peer_id) {
+    memset(p, 0, sizeof(*p));
+    snprintf(p->label, sizeof(p->label), "%s", label);
+    p->ip = strdup(ip);
+    p->peer_id = strdup(peer_id);
+}
+
+static const char *name_for_ip(const nb_record_t *head, const char *ip) {
+    for (; head; head = head->next) {
+        if (strcmp(head->ip, ip) == 0) return head->hostname;
+    }
+    return "<missing>";
+}
+
+static void test_duplicates(void) {
+    // A real "nas-1" keeps its name; duplicates are ordered by peer id
+    nb_pending_t p[5];
+    set_pending(&p[0], "nas", "10.0.0.2", "b");
+    set_pending(&p[1], "nas", "10.0.0.1", "a");
+    set_pending(&p[2], "nas-1", "10.0.0.9", "z");
+    set_pending(&p[3], "nas", "10.0.0.3", "c");
+    set_pending(&p[4], "box", "10.0.0.5", "q");
+
+    nb_record_t *head = build(p, 5);
+    CHECK(strcmp(name_for_ip(head, "10.0.0.1"), "nas") == 0, "peer a: %s", name_for_ip(head, "10.0.0.1"));
+    CHECK(strcmp(name_for_ip(head, "10.0.0.9"), "nas-1") == 0, "peer z: %s", name_for_ip(head, "10.0.0.9"));
+    CHECK(strcmp(name_for_ip(head, "10.0.0.2"), "nas-2") == 0, "peer b: %s", name_for_ip(head, "10.0.0.2"));
+    CHECK(strcmp(name_for_ip(head, "10.0.0.3"), "nas-3") == 0, "peer c: %s", name_for_ip(head, "10.0.0.3"));
+    CHECK(strcmp(name_for_ip(head, "10.0.0.5"), "box") == 0, "peer q: %s", name_for_ip(head, "10.0.0.5"));
+
+    size_t count = 0;
+    for (nb_record_t *r = head; r; r = r->next) {
+        CHECK(r->hostname_len == strlen(r->hostname), "hostname_len mismatch for '%s'", r->hostname);
+        count++;
+    }
+    CHECK(count == 5, "expected 5 records, got %zu", count);
+    free_record_list(head);
+}
+
+static void test_dns_label_priority(void) {
+    // NetBird assigned "nas" to peer zz; a hostname-only peer with a lower id
+    // must not take it
+    nb_pending_t p[2];
+    set_pending(&p[0], "nas", "10.0.3.1", "zz");
+    p[0].from_dns_label = 1;
+    set_pending(&p[1], "nas", "10.0.3.2", "aa");
+
+    nb_record_t *head = build(p, 2);
+    CHECK(strcmp(name_for_ip(head, "10.0.3.1"), "nas") == 0, "dns_label peer: %s", name_for_ip(head, "10.0.3.1"));
+    CHECK(strcmp(name_for_ip(head, "10.0.3.2"), "nas-1") == 0, "hostname peer: %s", name_for_ip(head, "10.0.3.2"));
+    free_record_list(head);
+}
+
+static void test_suffix_truncation(void) {
+    char full[NB_LABEL_MAX + 1], want[NB_LABEL_MAX + 1];
+    memset(full, 'a', 63);
+    full[63] = '\0';
+
+    // 63 + "-1" does not fit: the base is cut to 61 characters
+    nb_pending_t p[2];
+    set_pending(&p[0], full, "10.0.1.1", "a");
+    set_pending(&p[1], full, "10.0.1.2", "b");
+    nb_record_t *head = build(p, 2);
+    snprintf(want, sizeof(want), "%.61s-1", full);
+    CHECK(strcmp(name_for_ip(head, "10.0.1.1"), full) == 0, "first keeps full name");
+    CHECK(strcmp(name_for_ip(head, "10.0.1.2"), want) == 0, "got '%s', want '%s'",
+          name_for_ip(head, "10.0.1.2"), want);
+    CHECK(strlen(name_for_ip(head, "10.0.1.2")) == NB_LABEL_MAX, "suffixed label exceeds 63");
+    free_record_list(head);
+
+    // A cut that ends on '-' drops it rather than producing "--1"
+    memset(full, 'a', 60);
+    memcpy(full + 60, "-bc", 4);
+    set_pending(&p[0], full, "10.0.2.1", "a");
+    set_pending(&p[1], full, "10.0.2.2", "b");
+    head = build(p, 2);
+    snprintf(want, sizeof(want), "%.60s-1", full);
+    CHECK(strcmp(name_for_ip(head, "10.0.2.2"), want) == 0, "got '%s', want '%s'",
+          name_for_ip(head, "10.0.2.2"), want);
+    free_record_list(head);
+}
+
+static void test_fold_query(void) {
+    char key[NB_LABEL_MAX + 1];
+    CHECK(nb_fold_query("Peer-1", key, sizeof(key)) == 6 && strcmp(key, "peer-1") == 0,
+          "query fold: '%s'", key);
+    CHECK(nb_fold_query("a.b", key, sizeof(key)) == 0, "multi-label query accepted");
+    CHECK(nb_fold_query("", key, sizeof(key)) == 0, "empty query accepted");
+
+    char name[80];
+    memset(name, 'a', 64);
+    name[64] = '\0';
+    CHECK(nb_fold_query(name, key, sizeof(key)) == 0, "64-character query accepted");
+}
+
+int main(void) {
+    test_punycode();
+    test_ascii_folding();
+    test_ascii_labels();
+    test_invalid_utf8();
+    test_label_limit();
+    test_duplicates();
+    test_dns_label_priority();
+    test_suffix_truncation();
+    test_fold_query();
+
+    if (failures) {
+        printf("test_canon: %d failure(s)\n", failures);
+        return 1;
+    }
+    printf("test_canon: all tests passed\n");
+    return 0;
+}